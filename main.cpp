@@ -1,5 +1,6 @@
 #include "server.h"
 #include "logger.h"
+#include "proxy.h"
 #include <csignal>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -44,6 +45,7 @@ int main() {
     log_message(LOG_FILE, "Web-server started");
 
     startServer(PORT); // Запускаем сервер
+    proxyPoolInit(); // Открываем пул keep-alive соединений к upstream-серверам
 
     signal(SIGCHLD, reap_children); // Убираем зомби-процессы
     signal(SIGTERM, signal_handler); // Завершаем сервер при сигнале
@@ -71,6 +73,7 @@ int main() {
         }
 
         clients[slot] = client_fd; // Добавляем клиента в массив
+        proxyPoolRefresh(); // Переоткрываем разорванные соединения пула до fork()
 
         // Создаем новый процесс для каждого клиента
         pid_t pid = fork();
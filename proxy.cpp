@@ -0,0 +1,861 @@
+#include "proxy.h"
+#include "server.h"
+#include "logger.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h> // Для mmap (общая память между процессами)
+#include <sys/un.h>   // Для sockaddr_un
+#include <netinet/in.h>
+#include <netinet/tcp.h> // Для TCP_NODELAY
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio> // Для snprintf
+#include <ctime>
+#include <atomic>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+// Соединения пула открывает родительский процесс, а дочерние процессы
+// получают их через fork(). Состояние слотов хранится в общей памяти:
+// потомок захватывает свободный слот, отправляет запрос и возвращает
+// соединение в пул, если ответ был корректно разграничен.
+
+#define PROXY_MAX_UPSTREAMS 16
+#define MAX_CHUNK_SIZE (1ULL << 32) // Больше в одной части chunked не принимаем
+#define POOL_SLOTS (PROXY_POOL_SIZE > 0 ? PROXY_POOL_SIZE : 1) // PROXY_POOL_SIZE 0 выключает пул
+
+enum SlotState : uint32_t { SLOT_DEAD = 0, SLOT_FREE = 1, SLOT_BUSY = 2 };
+
+// Слово слота: (поколение << 2) | состояние. Поколение растёт при каждом
+// переподключении, поэтому потомок со старой копией таблицы fd не захватит слот
+struct SharedSlot {
+    std::atomic<uint32_t> word;
+    std::atomic<pid_t> owner;
+};
+
+struct SharedPool {
+    std::atomic<uint32_t> next;                     // Счётчик round-robin
+    std::atomic<int> active[PROXY_MAX_UPSTREAMS];   // Активные запросы (least-conn)
+    SharedSlot slots[PROXY_MAX_UPSTREAMS][POOL_SLOTS];
+};
+
+struct Upstream {
+    std::string name;
+    sockaddr_storage addr;
+    socklen_t addrlen;
+};
+
+static std::vector<Upstream> upstreams;
+static SharedPool* pool = nullptr;
+static bool leastConn = false;
+
+// Копия таблицы родителя, которую потомок получает при fork()
+static int slotFd[PROXY_MAX_UPSTREAMS][POOL_SLOTS];
+static uint32_t slotGen[PROXY_MAX_UPSTREAMS][POOL_SLOTS];
+static time_t lastAttempt[PROXY_MAX_UPSTREAMS][POOL_SLOTS];
+
+// Незавершённые подключения родителя (только в родительском процессе)
+static int pendingFd[PROXY_MAX_UPSTREAMS][POOL_SLOTS];
+static long long pendingSince[PROXY_MAX_UPSTREAMS][POOL_SLOTS];
+
+// Буферизованное чтение из сокета с тайм-аутом
+struct Reader {
+    int fd;
+    int timeoutMs = PROXY_READ_TIMEOUT_MS;
+    std::vector<char> buf;
+    size_t pos = 0;
+    size_t len = 0;
+    bool quickAck = false;
+    bool timedOut = false;
+    bool eof = false;
+    bool malformed = false; // Нарушено разграничение тела
+};
+
+static std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+static std::string trim(const std::string& s) {
+    size_t start = s.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos)
+        return "";
+    return s.substr(start, s.find_last_not_of(" \t\r\n") - start + 1);
+}
+
+// Поиск заголовка без учёта регистра имени
+static bool findHeader(const std::map<std::string, std::string>& headers, const std::string& name, std::string& value) {
+    for (const auto& header : headers) {
+        if (toLower(header.first) == name) {
+            value = trim(header.second);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Число заголовков с именем name без учёта регистра
+static int countHeader(const std::map<std::string, std::string>& headers, const std::string& name) {
+    int count = 0;
+    for (const auto& header : headers) {
+        if (toLower(header.first) == name)
+            ++count;
+    }
+    return count;
+}
+
+// Content-Length - только десятичные цифры, без знака и пробелов внутри
+static bool parseContentLength(const std::string& value, size_t& length) {
+    if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    length = std::stoull(value);
+    return true;
+}
+
+// Заголовки, которые относятся к конкретному соединению и не пересылаются
+static bool isHopByHop(const std::string& lowerName) {
+    return lowerName == "connection" || lowerName == "keep-alive" || lowerName == "proxy-connection" ||
+           lowerName == "te" || lowerName == "upgrade" || lowerName == "trailer";
+}
+
+static bool isIdempotent(const std::string& method) {
+    return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" ||
+           method == "OPTIONS" || method == "TRACE";
+}
+
+static bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool fill(Reader& reader) {
+    if (reader.buf.size() < 65536)
+        reader.buf.resize(65536);
+
+    while (true) {
+        struct pollfd pfd = { reader.fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, reader.timeoutMs);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready == 0) {
+            reader.timedOut = true;
+            return false;
+        }
+        if (ready < 0)
+            return false;
+
+#if PROXY_TCP_QUICKACK
+        // Обход для upstream, которые пишут заголовки и тело ответа отдельными
+        // send() при включённом алгоритме Нейгла (например, http.server в Python):
+        // на тёплом соединении второй сегмент ждёт отложенный ACK (~40 мс).
+        // Стоит один лишний системный вызов на каждое чтение из upstream
+        if (reader.quickAck) {
+            int option = 1;
+            setsockopt(reader.fd, IPPROTO_TCP, TCP_QUICKACK, &option, sizeof(option));
+        }
+#endif
+
+        ssize_t received = recv(reader.fd, reader.buf.data(), reader.buf.size(), 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                reader.timedOut = true;
+            return false;
+        }
+        if (received == 0) {
+            reader.eof = true;
+            return false;
+        }
+        reader.pos = 0;
+        reader.len = received;
+        return true;
+    }
+}
+
+// Читает строку до "\n" и убирает завершающие "\r\n"
+static bool readLine(Reader& reader, std::string& line) {
+    line.clear();
+    while (true) {
+        if (reader.pos == reader.len && !fill(reader))
+            return false;
+
+        const char* start = reader.buf.data() + reader.pos;
+        const char* newline = static_cast<const char*>(memchr(start, '\n', reader.len - reader.pos));
+        if (newline) {
+            line.append(start, newline - start);
+            reader.pos += newline - start + 1;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            return true;
+        }
+        line.append(start, reader.len - reader.pos);
+        reader.pos = reader.len;
+        if (line.size() > 65536)
+            return false;
+    }
+}
+
+// Пересылает ровно size байт из reader в dst
+static bool relayBytes(Reader& reader, int dst, size_t size) {
+    while (size > 0) {
+        if (reader.pos == reader.len && !fill(reader))
+            return false;
+
+        size_t chunk = std::min(size, reader.len - reader.pos);
+        if (!sendAll(dst, reader.buf.data() + reader.pos, chunk))
+            return false;
+        reader.pos += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+// Строка размера части: только шестнадцатеричные цифры и необязательное ";расширение"
+static bool parseChunkSize(const std::string& line, unsigned long long& size) {
+    size_t digits = line.find_first_not_of("0123456789abcdefABCDEF");
+    if (digits == std::string::npos)
+        digits = line.size();
+    if (digits == 0 || digits > 16)
+        return false;
+
+    size_t rest = line.find_first_not_of(" \t", digits);
+    if (rest != std::string::npos && line[rest] != ';')
+        return false;
+
+    size = strtoull(line.substr(0, digits).c_str(), nullptr, 16);
+    return size <= MAX_CHUNK_SIZE;
+}
+
+// Ожидает "\r\n" после данных части
+static bool readCrlf(Reader& reader) {
+    for (char expected : { '\r', '\n' }) {
+        if (reader.pos == reader.len && !fill(reader))
+            return false;
+        if (reader.buf[reader.pos++] != expected) {
+            reader.malformed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Пересылает тело в формате chunked. Размеры частей проверяются и отправляются
+// заново в каноническом виде, расширения и trailer-заголовки отбрасываются,
+// чтобы получатель разделил тело точно так же, как прокси
+static bool relayChunked(Reader& reader, int dst) {
+    std::string line;
+    while (true) {
+        if (!readLine(reader, line))
+            return false;
+
+        unsigned long long size;
+        if (!parseChunkSize(line, size)) {
+            reader.malformed = true;
+            return false;
+        }
+
+        char sizeLine[32];
+        int sizeLength = snprintf(sizeLine, sizeof(sizeLine), "%llx\r\n", size);
+        if (!sendAll(dst, sizeLine, sizeLength))
+            return false;
+
+        if (size == 0) {
+            // Trailer-заголовки до завершающей пустой строки
+            while (true) {
+                if (!readLine(reader, line))
+                    return false;
+                if (line.empty())
+                    return sendAll(dst, "\r\n", 2);
+                if (line.find(':') == std::string::npos) {
+                    reader.malformed = true;
+                    return false;
+                }
+            }
+        }
+
+        if (!relayBytes(reader, dst, size) || !readCrlf(reader) || !sendAll(dst, "\r\n", 2))
+            return false;
+    }
+}
+
+static bool relayUntilClose(Reader& reader, int dst) {
+    while (true) {
+        if (reader.pos == reader.len && !fill(reader))
+            return reader.eof;
+        if (!sendAll(dst, reader.buf.data() + reader.pos, reader.len - reader.pos))
+            return false;
+        reader.pos = reader.len;
+    }
+}
+
+// Соединение в пуле не должно ничего присылать: готовность к чтению
+// означает, что upstream закрыл его или прислал лишние данные
+static bool isStale(int fd) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) != 0;
+}
+
+static long long nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Начинает неблокирующее подключение. inProgress - подключение ещё не завершено
+static int startConnect(const Upstream& upstream, bool& inProgress) {
+    int fd = socket(upstream.addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    inProgress = false;
+    if (connect(fd, (const struct sockaddr*)&upstream.addr, upstream.addrlen) != 0) {
+        if (errno != EINPROGRESS && errno != EAGAIN) {
+            close(fd);
+            return -1;
+        }
+        inProgress = true;
+    }
+    return fd;
+}
+
+// Проверяет результат подключения и возвращает сокет в блокирующий режим
+static bool finishConnect(int fd, const Upstream& upstream) {
+    int error = 0;
+    socklen_t errlen = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errlen) != 0 || error != 0)
+        return false;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+
+    struct timeval timeout;
+    timeout.tv_sec = PROXY_READ_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (PROXY_READ_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (upstream.addr.ss_family != AF_UNIX) {
+        int option = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &option, sizeof(option));
+    }
+    return true;
+}
+
+// Подключение с ожиданием не дольше PROXY_CONNECT_TIMEOUT_MS. Только для
+// дочерних процессов: родитель подключается без ожидания в proxyPoolRefresh()
+static int connectUpstream(const Upstream& upstream) {
+    bool inProgress;
+    int fd = startConnect(upstream, inProgress);
+    if (fd < 0)
+        return -1;
+
+    long long deadline = nowMs() + PROXY_CONNECT_TIMEOUT_MS;
+    while (inProgress) {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        long long remaining = deadline - nowMs();
+        int ready = remaining > 0 ? poll(&pfd, 1, remaining) : 0;
+        if (ready < 0 && errno == EINTR)
+            continue; // SIGCHLD и т.п. не должны прерывать подключение
+        if (ready <= 0) {
+            close(fd);
+            return -1;
+        }
+        inProgress = false;
+    }
+
+    if (!finishConnect(fd, upstream)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool parseUpstream(const std::string& spec, Upstream& upstream) {
+    upstream.name = spec;
+    memset(&upstream.addr, 0, sizeof(upstream.addr));
+
+    if (spec.compare(0, 5, "unix:") == 0) {
+        std::string path = spec.substr(5);
+        struct sockaddr_un* addr = (struct sockaddr_un*)&upstream.addr;
+        if (path.empty() || path.size() >= sizeof(addr->sun_path))
+            return false;
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, path.c_str());
+        upstream.addrlen = sizeof(struct sockaddr_un);
+        return true;
+    }
+
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos)
+        return false;
+
+    struct addrinfo addrConfig, * addrResults;
+    memset(&addrConfig, 0, sizeof(addrConfig));
+    addrConfig.ai_family = AF_UNSPEC;
+    addrConfig.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(spec.substr(0, colon).c_str(), spec.substr(colon + 1).c_str(), &addrConfig, &addrResults) != 0)
+        return false;
+
+    memcpy(&upstream.addr, addrResults->ai_addr, addrResults->ai_addrlen);
+    upstream.addrlen = addrResults->ai_addrlen;
+    freeaddrinfo(addrResults);
+    return true;
+}
+
+bool isProxyUri(const std::string& uri) {
+    const std::string prefix = PROXY_PREFIX;
+    if (prefix.empty() || uri.compare(0, prefix.size(), prefix) != 0)
+        return false;
+    return uri.size() == prefix.size() || uri[prefix.size()] == '/' || uri[prefix.size()] == '?';
+}
+
+// Вызывается в родительском процессе до основного цикла
+void proxyPoolInit() {
+    std::string list = PROXY_UPSTREAMS;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        std::string spec = trim(list.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        if (!spec.empty()) {
+            Upstream upstream;
+            if (upstreams.size() >= PROXY_MAX_UPSTREAMS)
+                log_message(LOG_FILE, "Proxy: too many upstreams, ignoring " + spec);
+            else if (!parseUpstream(spec, upstream))
+                log_message(LOG_FILE, "Proxy: invalid upstream " + spec);
+            else
+                upstreams.push_back(upstream);
+        }
+        if (comma == std::string::npos)
+            break;
+        start = comma + 1;
+    }
+
+    if (upstreams.empty())
+        return; // Прокси выключен
+
+    leastConn = std::string(PROXY_BALANCE) == "least-conn";
+
+    void* shared = mmap(NULL, sizeof(SharedPool), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap() error");
+        log_message(LOG_FILE, "Proxy: mmap() error, connection pool disabled");
+        upstreams.clear();
+        return;
+    }
+    pool = new (shared) SharedPool(); // Нулевое слово слота - SLOT_DEAD
+
+    for (int u = 0; u < PROXY_MAX_UPSTREAMS; ++u) {
+        for (int i = 0; i < PROXY_POOL_SIZE; ++i) {
+            slotFd[u][i] = -1;
+            slotGen[u][i] = 0;
+            lastAttempt[u][i] = 0;
+            pendingFd[u][i] = -1;
+        }
+    }
+
+    proxyPoolRefresh();
+    log_message(LOG_FILE, "Proxy: " + std::to_string(upstreams.size()) + " upstream(s), balance " + PROXY_BALANCE);
+}
+
+// Открытое соединение становится доступным потомкам в новом поколении слота
+static void publishSlot(int u, int i, int fd, uint32_t word) {
+    slotFd[u][i] = fd;
+    slotGen[u][i] = (word >> 2) + 1;
+    pool->slots[u][i].owner.store(0);
+    pool->slots[u][i].word.store((slotGen[u][i] << 2) | SLOT_FREE);
+}
+
+// Вызывается в родительском процессе перед fork(): закрывает разорванные
+// соединения, освобождает слоты завершившихся потомков и переподключается.
+// Подключения неблокирующие и завершаются при следующих вызовах, чтобы
+// недоступный upstream не задерживал приём клиентов
+void proxyPoolRefresh() {
+    if (!pool)
+        return;
+
+    time_t now = time(nullptr);
+    for (size_t u = 0; u < upstreams.size(); ++u) {
+        for (int i = 0; i < PROXY_POOL_SIZE; ++i) {
+            SharedSlot& slot = pool->slots[u][i];
+            uint32_t word = slot.word.load();
+            uint32_t state = word & 3;
+
+            if (state == SLOT_BUSY) {
+                pid_t owner = slot.owner.load();
+                if (owner > 0 && kill(owner, 0) != 0 && errno == ESRCH)
+                    slot.word.compare_exchange_strong(word, (word & ~3u) | SLOT_DEAD);
+                continue;
+            }
+
+            if (state == SLOT_FREE) {
+                if (!isStale(slotFd[u][i]) ||
+                    !slot.word.compare_exchange_strong(word, (word & ~3u) | SLOT_DEAD))
+                    continue;
+            }
+
+            // Слот разорван: закрываем старое соединение
+            if (slotFd[u][i] >= 0) {
+                close(slotFd[u][i]);
+                slotFd[u][i] = -1;
+            }
+
+            // Подключение уже идёт: проверяем его без ожидания
+            if (pendingFd[u][i] >= 0) {
+                struct pollfd pfd = { pendingFd[u][i], POLLOUT, 0 };
+                if (poll(&pfd, 1, 0) > 0) {
+                    if (finishConnect(pendingFd[u][i], upstreams[u]))
+                        publishSlot(u, i, pendingFd[u][i], word);
+                    else
+                        close(pendingFd[u][i]);
+                    pendingFd[u][i] = -1;
+                } else if (nowMs() - pendingSince[u][i] >= PROXY_CONNECT_TIMEOUT_MS) {
+                    close(pendingFd[u][i]);
+                    pendingFd[u][i] = -1;
+                }
+                continue;
+            }
+
+            if (now - lastAttempt[u][i] < PROXY_RECONNECT_INTERVAL)
+                continue;
+            lastAttempt[u][i] = now;
+
+            bool inProgress;
+            int fd = startConnect(upstreams[u], inProgress);
+            if (fd < 0)
+                continue;
+            if (inProgress) {
+                pendingFd[u][i] = fd;
+                pendingSince[u][i] = nowMs();
+            } else if (finishConnect(fd, upstreams[u])) {
+                publishSlot(u, i, fd, word);
+            } else {
+                close(fd);
+            }
+        }
+    }
+}
+
+// Захватывает соединение из пула. Возвращает fd или -1, если свободных нет
+static int acquirePooled(int u, int& slotIndex) {
+    for (int i = 0; i < PROXY_POOL_SIZE; ++i) {
+        if (slotFd[u][i] < 0)
+            continue;
+
+        SharedSlot& slot = pool->slots[u][i];
+        uint32_t expected = (slotGen[u][i] << 2) | SLOT_FREE;
+        if (!slot.word.compare_exchange_strong(expected, (slotGen[u][i] << 2) | SLOT_BUSY))
+            continue;
+        slot.owner.store(getpid());
+
+        if (isStale(slotFd[u][i])) {
+            shutdown(slotFd[u][i], SHUT_RDWR);
+            slot.owner.store(0);
+            slot.word.store((slotGen[u][i] << 2) | SLOT_DEAD);
+            continue;
+        }
+
+        slotIndex = i;
+        return slotFd[u][i];
+    }
+    return -1;
+}
+
+// Возвращает соединение в пул или закрывает его
+static void releaseConnection(int u, int slotIndex, int fd, bool reusable) {
+    if (slotIndex < 0) {
+        close(fd);
+        return;
+    }
+
+    // shutdown() разрывает соединение и для копии fd в родительском процессе
+    if (!reusable)
+        shutdown(fd, SHUT_RDWR);
+    pool->slots[u][slotIndex].owner.store(0);
+    pool->slots[u][slotIndex].word.store((slotGen[u][slotIndex] << 2) | (reusable ? SLOT_FREE : SLOT_DEAD));
+}
+
+static int pickUpstream() {
+    int count = upstreams.size();
+    int first = pool->next.fetch_add(1) % count;
+    if (!leastConn)
+        return first;
+
+    int best = first;
+    for (int k = 1; k < count; ++k) {
+        int u = (first + k) % count;
+        if (pool->active[u].load() < pool->active[best].load())
+            best = u;
+    }
+    return best;
+}
+
+// framing - заголовок разграничения тела, собранный прокси вместо заголовков клиента
+static std::string buildRequestHead(int client_fd, const std::string& method, const std::string& uri,
+                                    const std::map<std::string, std::string>& headers, const std::string& framing,
+                                    const Upstream& upstream) {
+    std::string head = method + " " + uri + " HTTP/1.1\r\n" + framing;
+    std::string forwardedFor;
+
+    for (const auto& header : headers) {
+        std::string name = toLower(header.first);
+        if (isHopByHop(name) || name == "content-length" || name == "transfer-encoding")
+            continue;
+        if (name == "x-forwarded-for") {
+            forwardedFor = trim(header.second) + ", ";
+            continue;
+        }
+        head += header.first + ": " + trim(header.second) + "\r\n";
+    }
+
+    std::string host;
+    if (!findHeader(headers, "host", host))
+        head += "Host: " + upstream.name + "\r\n";
+
+    struct sockaddr_storage peer;
+    socklen_t peerlen = sizeof(peer);
+    char address[INET6_ADDRSTRLEN] = "";
+    if (getpeername(client_fd, (struct sockaddr*)&peer, &peerlen) == 0) {
+        if (peer.ss_family == AF_INET)
+            inet_ntop(AF_INET, &((struct sockaddr_in*)&peer)->sin_addr, address, sizeof(address));
+        else if (peer.ss_family == AF_INET6)
+            inet_ntop(AF_INET6, &((struct sockaddr_in6*)&peer)->sin6_addr, address, sizeof(address));
+    }
+    if (address[0] != '\0')
+        head += "X-Forwarded-For: " + forwardedFor + address + "\r\n";
+
+    head += "Connection: keep-alive\r\n\r\n";
+    return head;
+}
+
+// Разобранный статус и заголовки ответа upstream
+struct UpstreamResponse {
+    std::string statusLine;
+    std::string version;
+    int status = 0;
+    std::vector<std::pair<std::string, std::string>> headers;
+};
+
+static bool readResponseHead(Reader& reader, UpstreamResponse& response) {
+    // Промежуточные ответы 1xx пропускаем
+    do {
+        if (!readLine(reader, response.statusLine))
+            return false;
+
+        size_t space = response.statusLine.find(' ');
+        if (space == std::string::npos || response.statusLine.compare(0, 5, "HTTP/") != 0)
+            return false;
+        response.version = response.statusLine.substr(0, space);
+        response.status = atoi(response.statusLine.c_str() + space + 1);
+        if (response.status < 100 || response.status > 999)
+            return false;
+
+        response.headers.clear();
+        std::string line;
+        while (true) {
+            if (!readLine(reader, line))
+                return false;
+            if (line.empty())
+                break;
+            size_t colon = line.find(':');
+            if (colon == std::string::npos)
+                return false;
+            response.headers.emplace_back(line.substr(0, colon), trim(line.substr(colon + 1)));
+        }
+    } while (response.status >= 100 && response.status < 200 && response.status != 101);
+    return true;
+}
+
+// Отправляет запрос в upstream. Тело читается из client по мере отправки.
+static bool sendRequest(int fd, const std::string& head, Reader& client, bool chunked, size_t contentLength) {
+    if (!sendAll(fd, head.data(), head.size()))
+        return false;
+    if (chunked)
+        return relayChunked(client, fd);
+    return relayBytes(client, fd, contentLength);
+}
+
+// Пересылает ответ upstream клиенту. Возвращает true, если соединение
+// с upstream можно вернуть в пул
+static bool relayResponse(int client_fd, Reader& upstream, const std::string& method, const UpstreamResponse& response) {
+    bool chunked = false, hasLength = false, keepAlive = response.version == "HTTP/1.1";
+    size_t contentLength = 0;
+
+    std::string head = response.statusLine + "\r\n";
+    for (const auto& header : response.headers) {
+        std::string name = toLower(header.first);
+        std::string value = toLower(header.second);
+        if (name == "connection") {
+            if (value.find("close") != std::string::npos)
+                keepAlive = false;
+            else if (value.find("keep-alive") != std::string::npos)
+                keepAlive = true;
+        } else if (name == "transfer-encoding" && value.find("chunked") != std::string::npos) {
+            chunked = true;
+        } else if (name == "content-length") {
+            char* end = nullptr;
+            contentLength = strtoull(header.second.c_str(), &end, 10);
+            hasLength = end != header.second.c_str();
+        }
+        if (!isHopByHop(name))
+            head += header.first + ": " + header.second + "\r\n";
+    }
+    head += "Connection: close\r\n\r\n";
+
+    if (!sendAll(client_fd, head.data(), head.size()))
+        return false;
+
+    bool noBody = method == "HEAD" || response.status == 204 || response.status == 304;
+    if (noBody)
+        return keepAlive;
+    if (chunked)
+        return relayChunked(upstream, client_fd) && keepAlive;
+    if (hasLength)
+        return relayBytes(upstream, client_fd, contentLength) && keepAlive;
+
+    // Граница тела - закрытие соединения, повторно использовать его нельзя
+    relayUntilClose(upstream, client_fd);
+    return false;
+}
+
+void proxyRequest(int client_fd, const std::string& method, const std::string& uri, const std::map<std::string, std::string>& headers, const std::string& body) {
+    if (upstreams.empty()) {
+        log_message(LOG_FILE, "Proxy: no upstreams configured.");
+        badGateway(client_fd);
+        return;
+    }
+
+    // Разграничение тела запроса клиента. Если заголовки разграничения
+    // неоднозначны, upstream может разделить запрос иначе, чем прокси, и
+    // остаток попадёт в общее соединение пула как чужой запрос. Поэтому
+    // допускается ровно один Content-Length из цифр или ровно один
+    // Transfer-Encoding: chunked, а upstream получает заголовок, собранный прокси
+    std::string value, encoding;
+    int lengthCount = countHeader(headers, "content-length");
+    int encodingCount = countHeader(headers, "transfer-encoding");
+    findHeader(headers, "content-length", value);
+    findHeader(headers, "transfer-encoding", encoding);
+
+    bool chunked = encodingCount == 1;
+    size_t contentLength = 0;
+    if (lengthCount + encodingCount > 1 || (chunked && toLower(encoding) != "chunked") ||
+        (lengthCount == 1 && !parseContentLength(value, contentLength))) {
+        log_message(LOG_FILE, "Proxy: ambiguous request body framing.");
+        badRequest(client_fd);
+        return;
+    }
+
+    std::string framing;
+    if (chunked)
+        framing = "Transfer-Encoding: chunked\r\n";
+    else if (lengthCount == 1)
+        framing = "Content-Length: " + std::to_string(contentLength) + "\r\n";
+
+    // Уже прочитанная часть тела отдаётся первой, остальное читается из сокета
+    Reader client;
+    client.fd = client_fd;
+    client.timeoutMs = PROXY_CLIENT_TIMEOUT_MS;
+    client.buf.assign(body.begin(), body.end());
+    client.len = body.size();
+
+    // Повторить запрос на новом соединении можно, только если тело целиком
+    // в буфере, а метод идемпотентен: upstream мог обработать запрос и закрыть
+    // соединение, не успев ответить
+    bool replayable = !chunked && contentLength <= body.size() && isIdempotent(method);
+
+    int count = upstreams.size();
+    int first = pickUpstream();
+
+    for (int k = 0; k < count; ++k) {
+        int u = (first + k) % count;
+        const Upstream& target = upstreams[u];
+        std::string head = buildRequestHead(client_fd, method, uri, headers, framing, target);
+
+        pool->active[u].fetch_add(1);
+
+        int slotIndex = -1;
+        int fd = acquirePooled(u, slotIndex);
+        bool pooled = fd >= 0;
+        if (!pooled)
+            fd = connectUpstream(target);
+
+        if (fd < 0) {
+            pool->active[u].fetch_sub(1);
+            log_message(LOG_FILE, "Proxy: unable to connect to upstream " + target.name);
+            continue;
+        }
+
+        Reader upstream;
+        upstream.fd = fd;
+        upstream.quickAck = target.addr.ss_family != AF_UNIX;
+        UpstreamResponse response;
+        bool sent = sendRequest(fd, head, client, chunked, contentLength);
+        bool received = sent && readResponseHead(upstream, response);
+
+        // Соединение из пула могло быть закрыто upstream'ом за время простоя
+        if (!received && pooled && replayable && !upstream.timedOut && upstream.len == 0) {
+            releaseConnection(u, slotIndex, fd, false);
+            log_message(LOG_FILE, "Proxy: pooled connection to " + target.name + " was closed, retrying.");
+
+            client.pos = 0;
+            slotIndex = -1;
+            pooled = false;
+            fd = connectUpstream(target);
+            if (fd < 0) {
+                pool->active[u].fetch_sub(1);
+                log_message(LOG_FILE, "Proxy: unable to connect to upstream " + target.name);
+                continue;
+            }
+            upstream = Reader();
+            upstream.fd = fd;
+            upstream.quickAck = target.addr.ss_family != AF_UNIX;
+            sent = sendRequest(fd, head, client, chunked, contentLength);
+            received = sent && readResponseHead(upstream, response);
+        }
+
+        if (!received) {
+            releaseConnection(u, slotIndex, fd, false);
+            pool->active[u].fetch_sub(1);
+            if (!sent && (client.timedOut || client.eof || client.malformed)) {
+                log_message(LOG_FILE, "Proxy: client request body incomplete or malformed.");
+                badRequest(client_fd);
+            } else if (upstream.timedOut) {
+                log_message(LOG_FILE, "Proxy: upstream " + target.name + " timed out.");
+                gatewayTimeout(client_fd);
+            } else {
+                log_message(LOG_FILE, "Proxy: invalid response from upstream " + target.name);
+                badGateway(client_fd);
+            }
+            return;
+        }
+
+        bool reusable = relayResponse(client_fd, upstream, method, response) && upstream.pos == upstream.len;
+        releaseConnection(u, slotIndex, fd, reusable);
+        pool->active[u].fetch_sub(1);
+
+        log_message(LOG_FILE, "Proxy: " + method + " " + uri + " -> " + target.name + " " +
+                              std::to_string(response.status) + (pooled ? " (pooled)" : " (new connection)"));
+        return;
+    }
+
+    badGateway(client_fd);
+}
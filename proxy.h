@@ -0,0 +1,12 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <string>
+#include <map>
+
+bool isProxyUri(const std::string& uri);
+void proxyPoolInit();
+void proxyPoolRefresh();
+void proxyRequest(int client_fd, const std::string& method, const std::string& uri, const std::map<std::string, std::string>& headers, const std::string& body);
+
+#endif
@@ -1,6 +1,7 @@
 #include "server.h"
 #include "logger.h"
 #include "utils.h"
+#include "proxy.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -143,6 +144,13 @@ void serveStaticFile(int client_fd, const std::string& path) {
 }
 
 void route(int client_fd, const std::string& method, const std::string& uri, const std::map<std::string, std::string>& headers, const std::string& body) {
+    // Запросы с префиксом PROXY_PREFIX перенаправляются на upstream при любом методе.
+    // body здесь - только уже прочитанная часть тела, остальное proxyRequest читает из сокета
+    if (isProxyUri(uri)) {
+        proxyRequest(client_fd, method, uri, headers, body);
+        return;
+    }
+
     // Обработка только методов GET
     if (method == "GET") {
         // Формируем путь для файла
@@ -167,6 +175,20 @@ void route(int client_fd, const std::string& method, const std::string& uri, con
 }
 
 
+// Дочитывает запрос, пока в buffer не появится marker. false - соединение
+// закрыто, истёк тайм-аут или buffer заполнен
+static bool readUntil(int client_fd, std::vector<char>& buffer, int& received, const std::string& marker) {
+    while (std::search(buffer.begin(), buffer.begin() + received, marker.begin(), marker.end()) == buffer.begin() + received) {
+        if (received >= (int)buffer.size() - 1)
+            return false;
+        int bytesRead = recv(client_fd, buffer.data() + received, buffer.size() - 1 - received, 0);
+        if (bytesRead <= 0)
+            return false;
+        received += bytesRead;
+    }
+    return true;
+}
+
 // Функция для обработки клиентского запроса
 void respond(int client_fd) {
 	// Установим тайм-аут для операций чтения и записи
@@ -189,6 +211,24 @@ void respond(int client_fd) {
             log_message(LOG_FILE, "Client disconnected unexpectedly.");
         }
 
+        // Строка запроса могла прийти не целиком
+        readUntil(client_fd, buffer, received, "\n");
+
+        // Запрос к прокси нельзя передавать upstream с обрезанными заголовками
+        std::istringstream first_line(std::string(buffer.data(), received));
+        std::string first_method, first_uri;
+        first_line >> first_method >> first_uri;
+        if (isProxyUri(first_uri) && !readUntil(client_fd, buffer, received, "\r\n\r\n")) {
+            if (received >= (int)buffer.size() - 1) {
+                log_message(LOG_FILE, "Request headers too large.");
+                requestHeaderFieldsTooLarge(client_fd);
+            } else {
+                log_message(LOG_FILE, "Incomplete request headers.");
+                badRequest(client_fd);
+            }
+            return;
+        }
+
         log_message(LOG_FILE, "Request received from client.");
         buffer[received] = '\0'; // Завершаем строку
 
@@ -223,6 +263,17 @@ void respond(int client_fd) {
                 std::string name = line.substr(0, colon_pos);
                 std::string value = line.substr(colon_pos + 1);
                 value.erase(0, value.find_first_not_of(" \t")); // Убираем пробелы перед значением
+
+                // Повторный заголовок разграничения тела перезаписал бы первый в map,
+                // и прокси не заметил бы неоднозначный запрос
+                std::string lower_name = name;
+                std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(), ::tolower);
+                if (headers.count(name) && isProxyUri(uri) &&
+                    (lower_name == "content-length" || lower_name == "transfer-encoding")) {
+                    log_message(LOG_FILE, "Duplicate header: " + name);
+                    badRequest(client_fd);
+                    return;
+                }
                 headers[name] = value;
 
                 //log_message(LOG_FILE, "Header parsed: " + name + ": " + value);
@@ -232,8 +283,14 @@ void respond(int client_fd) {
                 return;
             }
         }
-    // Если метод POST, считываем тело запроса
-    if (method == "POST") {
+    if (isProxyUri(uri)) {
+        // Тело проксируемого запроса не буферизуется: берём только то, что уже пришло в buffer
+        std::streampos body_start_pos = request_stream.tellg();
+        if (body_start_pos >= 0 && body_start_pos < received) {
+            body = std::string(buffer.data() + body_start_pos, received - body_start_pos);
+        }
+    } else if (method == "POST") {
+        // Если метод POST, считываем тело запроса
         auto contentLengthIt = headers.find("Content-Length");
         if (contentLengthIt == headers.end()) {
             log_message(LOG_FILE, "Empty POST request.");
@@ -295,6 +352,39 @@ void internalServerError(int client_fd) {
    log_message(LOG_FILE, "Internal Server Error: Sent 500 response.");
 }
 
+void badGateway(int client_fd) {
+    std::string body = "502 Bad Gateway\nThe upstream server is unavailable or sent an invalid response.\n";
+    std::string response = "HTTP/1.1 502 Bad Gateway\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n" +
+                           body;
+    send(client_fd, response.c_str(), response.size(), 0);
+    log_message(LOG_FILE, "Bad Gateway: Sent 502 response.");
+}
+
+void gatewayTimeout(int client_fd) {
+    std::string body = "504 Gateway Timeout\nThe upstream server did not respond in time.\n";
+    std::string response = "HTTP/1.1 504 Gateway Timeout\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n" +
+                           body;
+    send(client_fd, response.c_str(), response.size(), 0);
+    log_message(LOG_FILE, "Gateway Timeout: Sent 504 response.");
+}
+
+void requestHeaderFieldsTooLarge(int client_fd) {
+    std::string body = "431 Request Header Fields Too Large\nThe request headers exceed the server limit.\n";
+    std::string response = "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n" +
+                           body;
+    send(client_fd, response.c_str(), response.size(), 0);
+    log_message(LOG_FILE, "Request Header Fields Too Large: Sent 431 response.");
+}
+
 void badRequest(int client_fd) {
     std::string body = "400 Bad Request\nThe server could not understand the request.\n";
     std::string response = "HTTP/1.1 400 Bad Request\r\n"
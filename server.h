@@ -4,13 +4,48 @@
 #include <string>
 #include <map>
 
+// Параметры можно переопределить при сборке: g++ -DPORT='"8081"' ...
+#ifndef PORT
 #define PORT "8080"
+#endif
 
+#ifndef LOG_FILE
 #define LOG_FILE "/home/margo/lab4/weblog"
+#endif
+#ifndef ROOT
 #define ROOT "/home/margo/lab4/web-server"
+#endif
 #define FIRST_PAGE "/start.html"
 #define MAX 1000
 
+// Обратный прокси: запросы с префиксом PROXY_PREFIX уходят на upstream-серверы.
+// По умолчанию выключен (пустой префикс)
+#ifndef PROXY_PREFIX
+#define PROXY_PREFIX ""                  // например "/app"
+#endif
+#ifndef PROXY_UPSTREAMS
+#define PROXY_UPSTREAMS ""               // через запятую: "host:port" или "unix:/path/app.sock"
+#endif
+#ifndef PROXY_BALANCE
+#define PROXY_BALANCE "round-robin"      // "round-robin" или "least-conn"
+#endif
+#ifndef PROXY_POOL_SIZE
+#define PROXY_POOL_SIZE 8                // keep-alive соединений на каждый upstream, 0 - без пула
+#endif
+#ifndef PROXY_TCP_QUICKACK
+#define PROXY_TCP_QUICKACK 1             // немедленный ACK для upstream с алгоритмом Нейгла
+#endif
+#ifndef PROXY_CONNECT_TIMEOUT_MS
+#define PROXY_CONNECT_TIMEOUT_MS 2000
+#endif
+#ifndef PROXY_READ_TIMEOUT_MS
+#define PROXY_READ_TIMEOUT_MS 30000      // ожидание данных от upstream
+#endif
+#ifndef PROXY_CLIENT_TIMEOUT_MS
+#define PROXY_CLIENT_TIMEOUT_MS 10000    // ожидание тела запроса от клиента, как в respond()
+#endif
+#define PROXY_RECONNECT_INTERVAL 1       // секунд между попытками переподключения
+
 extern int listenfd, clients[MAX];
 
 extern size_t payload_size;
@@ -23,7 +58,10 @@ void route(int client_fd, const std::string& method, const std::string& uri, con
 void serveStaticFile(int client_fd, const std::string& path, const std::string& mime_type);
 void methodNotAllowed(int client_fd);
 void badRequest(int client_fd);
+void requestHeaderFieldsTooLarge(int client_fd);
 void internalServerError(int client_fd);
+void badGateway(int client_fd);
+void gatewayTimeout(int client_fd);
 void notFound(int client_fd, const std::string& uri);
 void okResponse(int client_fd, const std::string& content, const std::string& content_type);
 void handlePostRequest(const std::string& uri, const std::string& body, const std::map<std::string, std::string>& headers, int client_fd);
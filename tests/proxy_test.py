@@ -0,0 +1,343 @@
+#!/usr/bin/env python3
+"""Tests and benchmark for the reverse-proxy route (run with `make test`).
+
+Builds several variants of the server with -D overrides. Each variant runs
+against tests/stand_in_backend.py on TCP and on a Unix socket. The script
+checks the proxy behaviour, then measures request latency with and without
+the pooled keep-alive connections, and with TCP_QUICKACK on and off.
+
+BENCH_REQUESTS sets the number of timed requests per variant (default 1000).
+"""
+import hashlib
+import http.client
+import os
+import re
+import shutil
+import signal
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SOURCES = ["main.cpp", "server.cpp", "logger.cpp", "utils.cpp", "proxy.cpp"]
+BACKEND = os.path.join(REPO, "tests", "stand_in_backend.py")
+BENCH_REQUESTS = int(os.environ.get("BENCH_REQUESTS", "1000"))
+POOL_SIZE = 8
+
+failures = []
+
+
+def check(name, condition, detail=""):
+    print("%s %s%s" % ("PASS" if condition else "FAIL", name, "" if condition else ": " + str(detail)))
+    if not condition:
+        failures.append(name)
+
+
+def free_port():
+    with socket.socket() as sock:
+        sock.bind(("127.0.0.1", 0))
+        return sock.getsockname()[1]
+
+
+def wait_for_port(port, timeout=10):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=1).close()
+            return
+        except OSError:
+            time.sleep(0.05)
+    raise RuntimeError("nothing is listening on port %d" % port)
+
+
+class Server:
+    """Build of the web server with its own port, log file and settings."""
+
+    def __init__(self, workdir, name, upstreams, pool_size=POOL_SIZE, quickack=1, balance="round-robin"):
+        self.port = free_port()
+        self.log = os.path.join(workdir, name + ".log")
+        self.binary = os.path.join(workdir, name)
+        self.pid = None
+        defines = {
+            "PORT": '"%d"' % self.port,
+            "LOG_FILE": '"%s"' % self.log,
+            "ROOT": '"%s"' % os.path.join(workdir, "www"),
+            "PROXY_PREFIX": '"/app"',
+            "PROXY_UPSTREAMS": '"%s"' % upstreams,
+            "PROXY_BALANCE": '"%s"' % balance,
+            "PROXY_POOL_SIZE": str(pool_size),
+            "PROXY_TCP_QUICKACK": str(quickack),
+        }
+        command = ["g++", "-std=c++17", "-o", self.binary]
+        command += ["-D%s=%s" % item for item in defines.items()]
+        command += [os.path.join(REPO, source) for source in SOURCES]
+        self.build = subprocess.Popen(command)
+
+    def start(self):
+        if self.build.wait() != 0:
+            raise RuntimeError("build of %s failed" % self.binary)
+        # The server daemonizes itself; its pid comes from the log
+        subprocess.run([self.binary], check=True)
+        wait_for_port(self.port)
+        deadline = time.time() + 5
+        while self.pid is None and time.time() < deadline:
+            with open(self.log) as log:
+                match = re.search(r"\[(\d+)\]: Web-server started", log.read())
+            if match:
+                self.pid = int(match.group(1))
+            else:
+                time.sleep(0.05)
+
+    def stop(self):
+        if self.pid:
+            os.kill(self.pid, signal.SIGTERM)
+            self.pid = None
+
+    def request(self, method, path, body=None, headers=None, chunked=False, timeout=30):
+        connection = http.client.HTTPConnection("127.0.0.1", self.port, timeout=timeout)
+        connection.request(method, path, body=body, headers=headers or {}, encode_chunked=chunked)
+        response = connection.getresponse()
+        data = response.read()
+        connection.close()
+        return response, data
+
+    def raw(self, *parts):
+        """Sends the parts with a pause in between, then reads until close."""
+        with socket.create_connection(("127.0.0.1", self.port), timeout=30) as sock:
+            for index, part in enumerate(parts):
+                if index:
+                    time.sleep(0.3)
+                sock.sendall(part)
+            chunks = []
+            while True:
+                chunk = sock.recv(65536)
+                if not chunk:
+                    return b"".join(chunks)
+                chunks.append(chunk)
+
+
+def start_backend(workdir, name, nagle=False):
+    port = free_port()
+    path = os.path.join(workdir, name + ".sock")
+    command = [sys.executable, BACKEND, "--tcp", str(port), "--unix", path]
+    if nagle:
+        command.append("--nagle")
+    process = subprocess.Popen(command)
+    wait_for_port(port)
+    while not os.path.exists(path):
+        time.sleep(0.05)
+    return process, port, path
+
+
+def backend_stats(server):
+    response, data = server.request("GET", "/app/stats")
+    counts = dict(item.split("=") for item in data.decode().split())
+    return int(counts["tcp"]) + int(counts["unix"])
+
+
+def warm_up(server, requests=3 * POOL_SIZE):
+    # The pool is filled by non-blocking connects on the following accept() calls
+    for _ in range(requests):
+        server.request("GET", "/app/warm")
+
+
+def test_proxy(server):
+    response, data = server.request("GET", "/")
+    check("static files are still served", response.status == 200 and data == b"hello\n", data)
+
+    warm_up(server)
+    tags = [server.request("GET", "/app/rr")[1].split()[0] for _ in range(4)]
+    check("round-robin over TCP and Unix socket upstreams",
+          sorted(tags) == [b"tcp", b"tcp", b"unix", b"unix"] and tags[0] != tags[1], tags)
+
+    before = backend_stats(server)
+    for _ in range(50):
+        server.request("GET", "/app/reuse")
+    opened = backend_stats(server) - before
+    check("upstream connections are reused", opened <= 2 * POOL_SIZE, "%d connections for 51 requests" % opened)
+
+    payload = os.urandom(3 * 1024 * 1024)
+    digest = hashlib.md5(payload).hexdigest().encode()
+    response, data = server.request("POST", "/app/upload", body=payload,
+                                    headers={"Content-Type": "application/octet-stream"})
+    check("Content-Length request body is streamed",
+          response.status == 200 and data.endswith(b"got %d bytes md5=%s" % (len(payload), digest)), data)
+
+    pieces = [payload[i:i + 100000] for i in range(0, len(payload), 100000)]
+    response, data = server.request("POST", "/app/upload", body=iter(pieces),
+                                    headers={"Transfer-Encoding": "chunked"}, chunked=True)
+    check("chunked request body is streamed",
+          response.status == 200 and data.endswith(b"got %d bytes md5=%s" % (len(payload), digest)), data)
+
+    response, data = server.request("GET", "/app/chunked")
+    check("chunked response is relayed",
+          response.status == 200 and response.getheader("Transfer-Encoding") == "chunked" and
+          data.endswith(b" /app/chunked"), data)
+
+    response, data = server.request("HEAD", "/app/head")
+    check("HEAD response has headers and no body",
+          response.status == 200 and response.getheader("Content-Length") is not None and data == b"",
+          "%d %r" % (response.status, data))
+
+    data = server.raw(b"GET /app/headers HTTP/1.1\r\nHost: x\r\nX-First: 1", b"\r\nX-Second: 2\r\n\r\n")
+    check("headers split across reads are proxied whole",
+          data.startswith(b"HTTP/1.1 200") and b"x-first" in data and b"x-second" in data, data[-80:])
+
+    head = b"GET /app/large HTTP/1.1\r\nX-Filler: "
+    data = server.raw(head + b"a" * (65534 - len(head)))
+    check("headers over the buffer size give 431", data.startswith(b"HTTP/1.1 431"), data[:40])
+
+    data = server.raw(b"POST /app/smuggle HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n"
+                      b"Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n")
+    check("Transfer-Encoding with Content-Length is rejected", data.startswith(b"HTTP/1.1 400"), data[:40])
+
+    smuggled = b"GET /smuggled HTTP/1.1\r\nHost: x\r\n\r\n"
+    for name, framing in (
+            ("Content-Length in different case", b"Content-Length: %d\r\ncontent-length: 0\r\n" % len(smuggled)),
+            ("repeated Content-Length", b"Content-Length: %d\r\nContent-Length: 0\r\n" % len(smuggled)),
+            ("repeated Transfer-Encoding", b"Transfer-Encoding: chunked\r\ntransfer-encoding: identity\r\n"),
+            ("non-numeric Content-Length", b"Content-Length: 3abc\r\n"),
+            ("negative Content-Length", b"Content-Length: -1\r\n")):
+        data = server.raw(b"POST /app/smuggle HTTP/1.1\r\nHost: x\r\n" + framing + b"\r\n" + smuggled)
+        check("%s is rejected" % name, data.startswith(b"HTTP/1.1 400"), data[:40])
+
+    for name, body in (
+            ("oversized chunk size", b"ffffffffffffffff\r\nab\r\n0\r\n\r\n"),
+            ("negative chunk size", b"-1\r\nab\r\n0\r\n\r\n"),
+            ("chunk size with junk", b"2 x\r\nab\r\n0\r\n\r\n"),
+            ("chunk data without CRLF", b"2\r\nabcd\r\n0\r\n\r\n")):
+        data = server.raw(b"POST /app/smuggle HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n" + body)
+        check("%s is rejected" % name, data.startswith(b"HTTP/1.1 400"), data[:40])
+
+    data = server.raw(b"POST /app/ext HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n"
+                      b"3;name=value\r\nabc\r\n0\r\nX-Trailer: 1\r\n\r\n")
+    check("chunk extensions and trailers are accepted",
+          data.startswith(b"HTTP/1.1 200") and b"got 3 bytes md5=" + hashlib.md5(b"abc").hexdigest().encode() in data,
+          data[:40])
+
+
+def test_least_conn(server):
+    warm_up(server)
+    slow = {}
+    thread = threading.Thread(target=lambda: slow.update(data=server.request("GET", "/app/slow")[1]))
+    thread.start()
+    time.sleep(0.5)  # Let the slow request reach its upstream
+    tags = [server.request("GET", "/app/lc")[1].split()[0] for _ in range(4)]
+    thread.join()
+    slow_tag = slow["data"].split()[0]
+    check("least-conn avoids the busy upstream",
+          len(set(tags)) == 1 and tags[0] != slow_tag, "slow on %r, others on %r" % (slow_tag, tags))
+
+
+def test_upstreams_down(server):
+    response, data = server.request("GET", "/app/down")
+    check("all upstreams down gives 502", response.status == 502, response.status)
+
+
+def test_unreachable_upstream(server):
+    # Connects to an upstream that never answers SYN must not delay accept()
+    start = time.perf_counter()
+    try:
+        for _ in range(5):
+            server.request("GET", "/", timeout=2)
+    except OSError as error:
+        check("unreachable upstream does not stall static files", False, error)
+        return
+    elapsed = time.perf_counter() - start
+    check("unreachable upstream does not stall static files", elapsed < 1.0, "%.2f s" % elapsed)
+
+
+def black_hole():
+    """Listener whose accept queue is full, so the kernel drops new SYNs."""
+    listener = socket.socket()
+    listener.bind(("127.0.0.1", 0))
+    listener.listen(0)
+    pending = []
+    for _ in range(2):
+        sock = socket.socket()
+        sock.setblocking(False)
+        sock.connect_ex(listener.getsockname())
+        pending.append(sock)
+    time.sleep(0.1)
+    return listener, pending
+
+
+def measure(server, requests):
+    request = b"GET /app/bench HTTP/1.1\r\nHost: bench\r\n\r\n"
+    latencies = []
+    for _ in range(requests):
+        start = time.perf_counter()
+        with socket.create_connection(("127.0.0.1", server.port)) as sock:
+            sock.sendall(request)
+            while sock.recv(65536):
+                pass
+        latencies.append((time.perf_counter() - start) * 1e6)
+    latencies.sort()
+    return statistics.mean(latencies), latencies[len(latencies) // 2], latencies[int(len(latencies) * 0.99)]
+
+
+def main():
+    workdir = tempfile.mkdtemp(prefix="web-server-test-")
+    os.mkdir(os.path.join(workdir, "www"))
+    with open(os.path.join(workdir, "www", "start.html"), "w") as page:
+        page.write("hello\n")
+
+    backends = []
+    servers = []
+    try:
+        nodelay = start_backend(workdir, "nodelay")
+        nagle = start_backend(workdir, "nagle", nagle=True)
+        backends += [nodelay[0], nagle[0]]
+
+        both = "127.0.0.1:%d,unix:%s" % (nodelay[1], nodelay[2])
+        main_server = Server(workdir, "proxy", both)
+        least_conn_server = Server(workdir, "least-conn", both, balance="least-conn")
+        down_server = Server(workdir, "down", "127.0.0.1:%d,unix:%s" % (free_port(), os.path.join(workdir, "none.sock")))
+        hole = black_hole()
+        blackhole_server = Server(workdir, "blackhole", "127.0.0.1:%d" % hole[0].getsockname()[1])
+        bench = []
+        for backend_name, backend in (("TCP_NODELAY", nodelay), ("Nagle", nagle)):
+            for pool_size in (POOL_SIZE, 0):
+                for quickack in (1, 0):
+                    name = "bench-%s-%d-%d" % (backend_name, pool_size, quickack)
+                    bench.append((backend_name, pool_size, quickack,
+                                  Server(workdir, name, "127.0.0.1:%d" % backend[1], pool_size, quickack)))
+        servers += [main_server, least_conn_server, down_server, blackhole_server] + [entry[3] for entry in bench]
+
+        for server in (main_server, least_conn_server, down_server, blackhole_server):
+            server.start()
+        test_proxy(main_server)
+        test_least_conn(least_conn_server)
+        test_upstreams_down(down_server)
+        test_unreachable_upstream(blackhole_server)
+
+        print("\nLatency, %d sequential requests per variant, TCP upstream (us):" % BENCH_REQUESTS)
+        print("%-12s %-9s %-9s %8s %8s %8s" % ("backend", "pool", "quickack", "mean", "p50", "p99"))
+        for backend_name, pool_size, quickack, server in bench:
+            server.start()
+            warm_up(server)
+            mean, p50, p99 = measure(server, BENCH_REQUESTS)
+            server.stop()
+            print("%-12s %-9s %-9s %8.0f %8.0f %8.0f" % (backend_name, "on" if pool_size else "off",
+                                                          "on" if quickack else "off", mean, p50, p99))
+    finally:
+        for server in servers:
+            server.stop()
+        for backend in backends:
+            backend.terminate()
+            backend.wait()
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    if failures:
+        print("\n%d test(s) failed" % len(failures))
+        return 1
+    print("\nAll tests passed")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
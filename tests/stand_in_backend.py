@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""Keep-alive HTTP/1.1 backend for the reverse-proxy tests.
+
+Listens on a TCP port and on a Unix socket at the same time. It answers:
+  GET  .../stats - "tcp=N unix=M": connections accepted on each listener
+  GET  .../chunked - response body sent with Transfer-Encoding: chunked
+  GET  .../headers - lower-cased names of the request headers received
+  GET  .../slow  - answers after 1.5 s
+  GET  other     - "<listener> <path>"
+  HEAD any       - headers of the GET response, without a body
+  POST any       - "<listener> got <length> bytes md5=<digest>"; the request
+                   body can use Content-Length or chunked encoding
+
+Every response except the chunked one carries Content-Length. With --nagle,
+Nagle stays on, and headers and body go out as two separate writes.
+"""
+import argparse
+import hashlib
+import os
+import socketserver
+import threading
+import time
+from http.server import BaseHTTPRequestHandler
+
+connections = {"tcp": 0, "unix": 0}
+connections_lock = threading.Lock()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    nagle = False
+
+    def setup(self):
+        self.disable_nagle_algorithm = self.server.tag == "tcp" and not self.nagle
+        super().setup()
+        with connections_lock:
+            connections[self.server.tag] += 1
+
+    def address_string(self):
+        return self.server.tag
+
+    def log_message(self, *args):
+        pass
+
+    def reply(self, body, chunked=False, send_body=True):
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain")
+        if chunked:
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            if send_body:
+                for part in (body[:5], body[5:]):
+                    self.wfile.write(b"%x\r\n%s\r\n" % (len(part), part))
+                self.wfile.write(b"0\r\n\r\n")
+        else:
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            if send_body:
+                self.wfile.write(body)
+
+    def get_body(self):
+        if self.path.endswith("/headers"):
+            return " ".join(sorted(name.lower() for name in self.headers.keys())).encode()
+        if self.path.endswith("/stats"):
+            with connections_lock:
+                return ("tcp=%d unix=%d" % (connections["tcp"], connections["unix"])).encode()
+        return ("%s %s" % (self.server.tag, self.path)).encode()
+
+    def do_GET(self):
+        if self.path.endswith("/slow"):
+            time.sleep(1.5)
+        self.reply(self.get_body(), chunked=self.path.endswith("/chunked"))
+
+    def do_HEAD(self):
+        self.reply(self.get_body(), send_body=False)
+
+    def do_POST(self):
+        try:
+            data = self.read_body()
+        except ValueError:
+            # Malformed or cut-off body: the proxy has already dropped the request
+            self.close_connection = True
+            return
+        self.reply(b"%s got %d bytes md5=%s" % (self.server.tag.encode(), len(data),
+                                                 hashlib.md5(data).hexdigest().encode()))
+
+    def read_body(self):
+        if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+            data = bytearray()
+            while True:
+                size = int(self.rfile.readline().split(b";")[0], 16)
+                if size == 0:
+                    while self.rfile.readline() not in (b"\r\n", b"\n", b""):
+                        pass
+                    break
+                data += self.rfile.read(size)
+                self.rfile.readline()
+        else:
+            data = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        return data
+
+
+class TcpServer(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+class UnixServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--tcp", type=int, required=True)
+    parser.add_argument("--unix", required=True)
+    parser.add_argument("--nagle", action="store_true")
+    args = parser.parse_args()
+
+    Handler.nagle = args.nagle
+
+    tcp = TcpServer(("127.0.0.1", args.tcp), Handler)
+    tcp.tag = "tcp"
+    if os.path.exists(args.unix):
+        os.unlink(args.unix)
+    unix = UnixServer(args.unix, Handler)
+    unix.tag = "unix"
+
+    threading.Thread(target=unix.serve_forever, daemon=True).start()
+    tcp.serve_forever()
+
+
+if __name__ == "__main__":
+    main()